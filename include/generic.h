@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+
 struct Point {
     double x;
     double y;
@@ -24,6 +26,27 @@ struct ColorIntensity {
     double b;
 };
 
+// Linear, unclamped radiance written by the tracer
+struct HdrColor {
+    float r;
+    float g;
+    float b;
+};
+
+// Final display pixel, byte order matches SDL_PIXELFORMAT_RGBA32
+struct PackedColor {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a = 255;
+};
+
+// Per pixel offsets for the two shadow sample dimensions
+struct SampleNoise {
+    double u;
+    double v;
+};
+
 struct Intercept {
     bool intercepts;
     double distance;
@@ -38,8 +61,10 @@ Point vector_sub(Point v1, Point v2);
 Point vector_scalar(Point v1, double scalar);
 Point vector_div(Point v1, double scalar);
 double vector_mag(Point v1);
+Point vector_cross(Point v1, Point v2);
 Color color_scalar(Color v1, double scalar);
 Color color_intensity_mul_to_col(Color v1, ColorIntensity intensity);
 ColorIntensity color_intensity_mul(ColorIntensity i1, ColorIntensity i2);
 ColorIntensity color_intensity_add(ColorIntensity i1, ColorIntensity i2);
 ColorIntensity color_intensity_clamp(ColorIntensity intensity);
+HdrColor color_intensity_to_hdr(Color albedo, ColorIntensity intensity);
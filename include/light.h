@@ -2,6 +2,11 @@
 
 #include "generic.h"
 #include "render_object.h"
+#include <algorithm>
+#include <cmath>
+
+// Upper bound on shadow rays per hit, lets callers batch them on the stack
+const int MAX_SHADOW_SAMPLES = 64;
 
 class Light {
 public:
@@ -16,6 +21,14 @@ public:
                                          Point point) {
         throw "Not Implemented";
     };
+    // Lights with more than one sample cast soft shadows, the first
+    // get_shadow_early_out() samples decide if the rest are needed
+    virtual int get_shadow_samples() { return 1; }
+    virtual int get_shadow_early_out() { return 1; }
+    virtual void get_shadow_targets(Point point, int first, int last,
+                                    SampleNoise noise, Point *targets) {
+        throw "Not Implemented";
+    };
 };
 
 class AmbientLight : public Light {
@@ -86,3 +99,54 @@ public:
         return intensity;
     };
 };
+
+class SphereLight : public PointLight {
+public:
+    double radius;
+    int samples;
+    int early_out;
+    SphereLight(ColorIntensity intensity, Point position, double radius,
+                int samples = 16, int early_out = 4,
+                Color color = Color{255, 255, 255})
+        : PointLight(intensity, position, color) {
+        // Counts are clamped by the caller, where the sample arrays live
+        this->radius = radius;
+        this->samples = samples;
+        this->early_out = early_out;
+    };
+    int get_shadow_samples() { return this->samples; }
+    int get_shadow_early_out() { return this->early_out; }
+    void get_shadow_targets(Point point, int first, int last,
+                            SampleNoise noise, Point *targets) {
+        // Silhouette of the sphere seen from point: a disk of radius
+        // r * sqrt(1 - r^2 / d^2), r^2 / d closer than the center
+        Point w = vector_sub(this->position, point);
+        double d = vector_mag(w);
+        w = vector_div(w, d);
+        double ratio = std::min(this->radius / d, 1.0);
+        double disk_radius = this->radius * sqrt(1 - ratio * ratio);
+        Point disk_center = vector_sub(
+                this->position, vector_scalar(w, this->radius * ratio));
+        Point axis = fabs(w.x) > 0.9 ? Point{0, 1, 0} : Point{1, 0, 0};
+        Point t = vector_cross(axis, w);
+        t = vector_div(t, vector_mag(t));
+        Point b = vector_cross(w, t);
+
+        // R2 low discrepancy sequence, every prefix is well spread so the
+        // early out samples cover the whole disk. The per pixel noise
+        // offsets turn the shared pattern into blue noise across the image.
+        double g = 1.32471795724474602596;
+        for (int k = first; k < last; k++) {
+            double u = 0.5 + k / g + noise.u;
+            double v = 0.5 + k / (g * g) + noise.v;
+            u -= floor(u);
+            v -= floor(v);
+
+            double r = disk_radius * sqrt(u);
+            double theta = 2 * M_PI * v;
+            Point offset = vector_add(vector_scalar(t, r * cos(theta)),
+                                      vector_scalar(b, r * sin(theta)));
+            targets[k - first] = vector_add(disk_center, offset);
+        }
+    };
+};
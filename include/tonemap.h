@@ -0,0 +1,33 @@
+#pragma once
+#include <generic.h>
+#include <vector>
+
+// Float render target. Channels are stored as separate planes so the
+// post-process loop runs over contiguous floats and vectorizes.
+class HdrBuffer {
+public:
+    int width;
+    int height;
+    std::vector<float> r;
+    std::vector<float> g;
+    std::vector<float> b;
+    HdrBuffer(int width, int height) {
+        this->width = width;
+        this->height = height;
+        this->r.assign(width * height, 0);
+        this->g.assign(width * height, 0);
+        this->b.assign(width * height, 0);
+    };
+    void set(int x, int y, HdrColor color) {
+        int index = y * this->width + x;
+        this->r[index] = color.r;
+        this->g[index] = color.g;
+        this->b[index] = color.b;
+    };
+};
+
+// Exposure, extended Reinhard tone mapping, gamma 2.0 and 8-bit
+// quantization over the whole buffer. Radiance at white_point (after
+// exposure) maps to full scale. pixels is resized to width * height.
+void tonemap(HdrBuffer *buffer, std::vector<PackedColor> *pixels,
+             float exposure, float white_point);
@@ -31,6 +31,12 @@ double vector_mag(Point v1) {
     return magnitude;
 }
 
+Point vector_cross(Point v1, Point v2) {
+    Point point = Point{v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z,
+                        v1.x * v2.y - v1.y * v2.x};
+    return point;
+}
+
 Color color_scalar(Color v1, double scalar) {
     Color color =
             Color{int(v1.r * scalar), int(v1.g * scalar), int(v1.b * scalar)};
@@ -69,3 +75,11 @@ ColorIntensity color_intensity_clamp(ColorIntensity intensity) {
     }
     return new_intensity;
 }
+
+HdrColor color_intensity_to_hdr(Color albedo, ColorIntensity intensity) {
+    double scalar = 1.0 / 255.0;
+    HdrColor color = HdrColor{float(albedo.r * scalar * intensity.r),
+                              float(albedo.g * scalar * intensity.g),
+                              float(albedo.b * scalar * intensity.b)};
+    return color;
+}
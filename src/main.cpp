@@ -1,4 +1,5 @@
 #include <SDL2/SDL.h>
+#include <algorithm>
 #include <chrono>
 #include <future>
 #include <generic.h>
@@ -9,6 +10,7 @@
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <tonemap.h>
 #include <utility>
 #include <vector>
 
@@ -41,10 +43,21 @@ CanvasPoint change_to_matrix_coords(CanvasPoint point) {
     return new_point;
 }
 
-void SDL_Draw(SDL_Renderer *renderer, Color color, CanvasPoint canvas) {
-    canvas = change_to_matrix_coords(canvas);
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-    SDL_RenderDrawPoint(renderer, canvas.x, canvas.y);
+// Interleaved gradient noise, a cheap per pixel value in [0, 1) with a
+// blue noise like spectrum used to decorrelate shadow sample patterns
+double interleaved_gradient_noise(CanvasPoint canvas) {
+    double f = 0.06711056 * canvas.x + 0.00583715 * canvas.y;
+    f = 52.9829189 * (f - floor(f));
+    return f - floor(f);
+}
+
+// The v offset uses the noise with x and y swapped. A fixed pixel shift
+// would only add a constant to u (the noise is linear before its frac
+// steps), the swap gives a different gradient so (u, v) covers the square.
+SampleNoise get_sample_noise(CanvasPoint canvas) {
+    CanvasPoint transposed = CanvasPoint{canvas.y, canvas.x, 0};
+    return SampleNoise{interleaved_gradient_noise(canvas),
+                       interleaved_gradient_noise(transposed)};
 }
 
 bool is_shadowed(Point point, Light *light,
@@ -59,11 +72,60 @@ bool is_shadowed(Point point, Light *light,
     return false;
 }
 
-Color raytrace(Point viewport, std::vector<RenderObject *> *render_objects,
-               std::vector<Light *> *lights) {
+int count_occluded(Point point, Light *light, int first, int last,
+                   SampleNoise noise,
+                   std::vector<RenderObject *> *render_objects) {
+    // The whole batch is tested against one object before moving to the
+    // next, so each object is visited once rather than once per ray
+    Point targets[MAX_SHADOW_SAMPLES];
+    bool occluded[MAX_SHADOW_SAMPLES] = {};
+    int count = last - first;
+    int total = 0;
+    light->get_shadow_targets(point, first, last, noise, targets);
+
+    for (size_t i = 0; i < render_objects->size() && total < count; i++) {
+        RenderObject *object = render_objects->at(i);
+        for (int k = 0; k < count; k++) {
+            if (!occluded[k] && object->is_shadowed_point(point, targets[k])) {
+                occluded[k] = true;
+                total++;
+            }
+        }
+    }
+    return total;
+}
+
+// Fraction of the light visible from point, 0 is fully shadowed
+double shadow_visibility(Point point, Light *light, SampleNoise noise,
+                         std::vector<RenderObject *> *render_objects) {
+    // Clamped here since count_occluded sizes its arrays by the maximum
+    int samples = std::min(light->get_shadow_samples(), MAX_SHADOW_SAMPLES);
+    if (samples <= 1) {
+        return is_shadowed(point, light, render_objects) ? 0 : 1;
+    }
+
+    // Most hits are fully lit or fully in umbra, only the penumbra needs
+    // the remaining samples
+    int early_out = std::clamp(light->get_shadow_early_out(), 1, samples);
+    int occluded = count_occluded(point, light, 0, early_out, noise,
+                                  render_objects);
+    if (occluded == 0) {
+        return 1;
+    }
+    if (occluded == early_out) {
+        return 0;
+    }
+    occluded += count_occluded(point, light, early_out, samples, noise,
+                               render_objects);
+    return 1 - double(occluded) / samples;
+}
+
+HdrColor raytrace(Point viewport, SampleNoise noise,
+                  std::vector<RenderObject *> *render_objects,
+                  std::vector<Light *> *lights) {
     Point origin = Point{0, 0, 0};
-    Color color = Color{0, 0, 0}; // Black
-    // Color color = Color{255, 255, 255}; // White
+    HdrColor color = HdrColor{0, 0, 0}; // Black
+    // HdrColor color = HdrColor{1, 1, 1}; // White
 
     int distance = std::numeric_limits<int>::max();
     bool intercepts = false;
@@ -74,7 +136,6 @@ Color raytrace(Point viewport, std::vector<RenderObject *> *render_objects,
         Intercept intercept = render_objects->at(i)->trace(origin, viewport);
         if (intercept.intercepts and intercept.distance < distance) {
             distance = intercept.distance;
-            color = intercept.color;
             intercept_point = intercept.point;
             intercepts = true;
             closest_object = render_objects->at(i);
@@ -89,60 +150,65 @@ Color raytrace(Point viewport, std::vector<RenderObject *> *render_objects,
         for (int i = 0; i < lights->size(); i++) {
             Light *light = lights->at(i);
             // Check if shadowed
+            double visibility = 1;
             if (shadows) {
-                bool shadowed =
-                        is_shadowed(intercept_point, light, render_objects);
-                if (shadowed) {
+                visibility = shadow_visibility(intercept_point, light, noise,
+                                               render_objects);
+                if (visibility == 0) {
                     // std::cout << "Shadowed" << std::endl;
                     continue;
-                } else {
-                    // std::cout << "Not Shadowed" << std::endl;
                 }
             }
             // Calculate intensity
-            intensity = color_intensity_add(intensity, light->get_intensity(closest_object, intercept_point));
+            ColorIntensity light_intensity =
+                    light->get_intensity(closest_object, intercept_point);
+            light_intensity = color_intensity_mul(
+                    light_intensity,
+                    ColorIntensity{visibility, visibility, visibility});
+            intensity = color_intensity_add(intensity, light_intensity);
             double factor = 1;
             intensity = color_intensity_mul(
                     intensity, ColorIntensity{factor, factor, factor});
-            intensity = color_intensity_clamp(intensity);
         };
-        color = color_intensity_mul_to_col(closest_object->get_color(), intensity);
+        // Left unclamped, exposure and tone mapping happen in tonemap()
+        color = color_intensity_to_hdr(closest_object->get_color(), intensity);
     }
 
     return color;
 }
 
-std::pair<std::pair<int, int>, Color>
+std::pair<std::pair<int, int>, HdrColor>
 get_pixel(int i, int j, std::vector<RenderObject *> *render_objects,
           std::vector<Light *> *lights) {
     CanvasPoint canvas = CanvasPoint{i, j, 0};
     Point viewport = canvas_to_view_transform(canvas);
-    Color color = raytrace(viewport, render_objects, lights);
+    SampleNoise noise = get_sample_noise(canvas);
+    HdrColor color = raytrace(viewport, noise, render_objects, lights);
     return std::make_pair(std::make_pair(i, j), color);
 }
 
-std::vector<std::pair<std::pair<int, int>, Color>>
-get_pixels(std::pair<int, int> width_range,
-           std::vector<RenderObject *> *render_objects,
-           std::vector<Light *> *lights) {
-    std::vector<std::pair<std::pair<int, int>, Color>> pixels;
-
+void get_pixels(std::pair<int, int> width_range, HdrBuffer *buffer,
+                std::vector<RenderObject *> *render_objects,
+                std::vector<Light *> *lights) {
+    // Each batch owns a disjoint column range so writes need no locking
     for (int i = width_range.first; i < width_range.second; i++) {
-        for (int j = -SCREEN_HEIGHT / 2; j < SCREEN_HEIGHT / 2; j++) {
+        for (int j = -SCREEN_HEIGHT / 2 + 1; j <= SCREEN_HEIGHT / 2; j++) {
             CanvasPoint canvas = CanvasPoint{i, j, 0};
             Point viewport = canvas_to_view_transform(canvas);
-            Color color = raytrace(viewport, render_objects, lights);
-            pixels.push_back(std::make_pair(std::make_pair(i, j), color));
+            SampleNoise noise = get_sample_noise(canvas);
+            HdrColor color = raytrace(viewport, noise, render_objects, lights);
+            CanvasPoint matrix = change_to_matrix_coords(canvas);
+            buffer->set(matrix.x, matrix.y, color);
         }
     }
-    return pixels;
 }
 
-void render(SDL_Renderer *renderer, std::vector<RenderObject *> *render_objects,
-            std::vector<Light *> *lights) {
+void render(SDL_Renderer *renderer, SDL_Texture *texture, HdrBuffer *buffer,
+            std::vector<PackedColor> *pixels,
+            std::vector<RenderObject *> *render_objects,
+            std::vector<Light *> *lights, float exposure, float white_point) {
 
-    std::vector<std::future<std::vector<std::pair<std::pair<int, int>, Color>>>>
-            futures;
+    std::vector<std::future<void>> futures;
 
     int batch_length = SCREEN_WIDTH / NUM_THREADS;
 
@@ -152,21 +218,19 @@ void render(SDL_Renderer *renderer, std::vector<RenderObject *> *render_objects,
 
         std::pair<int, int> width_range = std::make_pair(start, end);
         futures.push_back(std::async(std::launch::async, get_pixels,
-                                     width_range, render_objects, lights));
+                                     width_range, buffer, render_objects,
+                                     lights));
     }
 
     for (auto &future : futures) {
-        auto result = future.get();
-        int result_size = result.size();
-        for (int k = 0; k < result_size; k++) {
-            std::pair<std::pair<int, int>, Color> pixel = result.at(k);
-            std::pair<int, int> coords = pixel.first;
-            Color color = pixel.second;
-            SDL_Draw(renderer, color,
-                     CanvasPoint{coords.first, coords.second, 0});
-        }
+        future.get();
     }
     futures.clear();
+
+    tonemap(buffer, pixels, exposure, white_point);
+    SDL_UpdateTexture(texture, NULL, pixels->data(),
+                      SCREEN_WIDTH * sizeof(PackedColor));
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
 }
 
 void free_memory(std::vector<RenderObject *> *render_objects,
@@ -211,6 +275,18 @@ int main(int argc, char *argv[]) {
 
     surface = SDL_GetWindowSurface(window);
 
+    SDL_Texture *texture =
+            SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
+                              SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH,
+                              SCREEN_HEIGHT);
+    HdrBuffer buffer = HdrBuffer(SCREEN_WIDTH, SCREEN_HEIGHT);
+    std::vector<PackedColor> pixels;
+    // Hand tuned to the blue sphere's specular highlight (about 1.4) at the
+    // starting light position. The point light wanders and overlapping
+    // lights can exceed it, anything brighter clips to white.
+    float exposure = 1.0f;
+    float white_point = 1.4f;
+
     bool close = false;
     Point offset = Point{0, 0, 3};
     // offset = Point{0, 0, 0};
@@ -218,8 +294,10 @@ int main(int argc, char *argv[]) {
     // Make lights
     std::vector<Light *> lights;
     lights.push_back(new AmbientLight({0.2, 0.2, 0.2}));
-    lights.push_back(new PointLight({0.6, 0.6, 0.6},
-                                    vector_add(Point{2, 1, 0}, offset)));
+    // lights.push_back(new PointLight({0.6, 0.6, 0.6},
+    //                                 vector_add(Point{2, 1, 0}, offset)));
+    lights.push_back(new SphereLight({0.6, 0.6, 0.6},
+                                     vector_add(Point{2, 1, 0}, offset), 0.5));
     lights.push_back(new DirectionalLight({0.2, 0.2, 0.2}, Point{1, 4, 4}));
 
     // Make renderable objects
@@ -254,7 +332,8 @@ int main(int argc, char *argv[]) {
         SDL_RenderClear(renderer);
         update_state(renderer, &render_objects, &lights);
 
-        render(renderer, &render_objects, &lights);
+        render(renderer, texture, &buffer, &pixels, &render_objects, &lights,
+               exposure, white_point);
 
         SDL_RenderPresent(renderer);
 
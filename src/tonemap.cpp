@@ -0,0 +1,32 @@
+#include "tonemap.h"
+#include <algorithm>
+#include <cmath>
+
+static inline uint8_t tonemap_channel(float value, float exposure,
+                                      float inv_white_sq) {
+    value = std::max(value * exposure, 0.0f);
+    // Extended Reinhard reaches 1 at the white point, sqrt is the gamma 2.0
+    // encode
+    value = value * (1.0f + value * inv_white_sq) / (1.0f + value);
+    value = std::sqrt(std::min(value, 1.0f));
+    return uint8_t(value * 255.0f + 0.5f);
+}
+
+void tonemap(HdrBuffer *buffer, std::vector<PackedColor> *pixels,
+             float exposure, float white_point) {
+    int size = buffer->width * buffer->height;
+    float inv_white_sq = 1.0f / (white_point * white_point);
+    pixels->resize(size);
+
+    const float *__restrict r = buffer->r.data();
+    const float *__restrict g = buffer->g.data();
+    const float *__restrict b = buffer->b.data();
+    PackedColor *__restrict out = pixels->data();
+
+    for (int i = 0; i < size; i++) {
+        out[i].r = tonemap_channel(r[i], exposure, inv_white_sq);
+        out[i].g = tonemap_channel(g[i], exposure, inv_white_sq);
+        out[i].b = tonemap_channel(b[i], exposure, inv_white_sq);
+        out[i].a = 255;
+    }
+}